@@ -0,0 +1,379 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adxl345.h"
+
+/*
+ * Fast boot PID 1: loads the ADXL345 driver, reads a first sample and only
+ * then hands off to the acquisition program and to the regular init.
+ *
+ * Every milestone is timed with CLOCK_BOOTTIME (time since the kernel
+ * started) and logged to the console and to /dev/kmsg, so `dmesg | grep
+ * fastboot` gives the boot breakdown of a release. The I2C probe runs inside
+ * finit_module(), its time is taken from the driver's "ADXL345 initialized"
+ * message in /dev/kmsg. Options are read from the kernel command line:
+ *   fastboot.module=<path>   driver to load (/lib/modules/adxl345.ko)
+ *   fastboot.budget_ms=<ms>  time to first sample budget, 0 = no check
+ *   fastboot.acq=<path>      acquisition program started on the device (/bin/adxl345d),
+ *                            called as <path> /dev/adxl345-0 /run/adxl345-0.sock
+ *   fastboot.root=<name>     block device of the full userland (e.g. vda), switched
+ *                            to before starting fastboot.next; none = stay in the initramfs
+ *   fastboot.rootfstype=<t>  its file system (ext4)
+ *   fastboot.next=<path>     init started afterwards (/sbin/init)
+ *
+ * /dev, /dev/shm and /run are tmpfs and are moved to the new root, so the
+ * acquisition program keeps serving clients on /run/adxl345-0.sock.
+ */
+
+#define DEVICE_NAME "adxl345-0"
+#define DEVICE_PATH "/dev/" DEVICE_NAME
+#define SYSFS_DEV "/sys/class/misc/" DEVICE_NAME "/dev"
+#define PROBE_TIMEOUT_MS 2000
+#define SAMPLE_TIMEOUT_MS 1000 // the FIFO watermark interrupt comes after 0.2 s at 100 Hz
+#define PROBE_MESSAGE "ADXL345 initialized" // last message of adxl345_probe()
+#define SOCKET_PATH "/run/adxl345-0.sock"
+#define NEW_ROOT "/newroot"
+
+static char module_path[128] = "/lib/modules/adxl345.ko";
+static char acq_path[128] = "/bin/adxl345d";
+static char next_path[128] = "/sbin/init";
+static char root_name[32];
+static char root_type[32] = "ext4";
+static long budget_ms;
+
+static int kmsg_fd = -1;
+static long last_us;
+
+static long boottime_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+static void log_msg(const char *fmt, ...)
+{
+    char line[160];
+    int len;
+    va_list ap;
+
+    len = snprintf(line, sizeof(line), "fastboot: ");
+    va_start(ap, fmt);
+    len += vsnprintf(line + len, sizeof(line) - len, fmt, ap);
+    va_end(ap);
+    if (len >= (int)sizeof(line) - 1)
+        len = sizeof(line) - 2;
+    line[len++] = '\n';
+
+    write(STDOUT_FILENO, line, len);
+    if (kmsg_fd >= 0)
+        write(kmsg_fd, line, len);
+}
+
+/* Logs the time since the kernel started and since the previous milestone */
+static long milestone_at(const char *name, long now)
+{
+    log_msg("%-14s %6ld.%03ld ms (+%ld.%03ld ms)", name, now / 1000, now % 1000,
+            (now - last_us) / 1000, (now - last_us) % 1000);
+    last_us = now;
+    return now;
+}
+
+static long milestone(const char *name)
+{
+    return milestone_at(name, boottime_us());
+}
+
+static void parse_cmdline(void)
+{
+    char buf[1024];
+    char *tok, *save;
+    ssize_t len;
+    int fd;
+
+    fd = open("/proc/cmdline", O_RDONLY);
+    if (fd < 0)
+        return;
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0)
+        return;
+    buf[len] = '\0';
+
+    for (tok = strtok_r(buf, " \n", &save); tok; tok = strtok_r(NULL, " \n", &save))
+    {
+        if (!strncmp(tok, "fastboot.module=", 16))
+            snprintf(module_path, sizeof(module_path), "%s", tok + 16);
+        else if (!strncmp(tok, "fastboot.acq=", 13))
+            snprintf(acq_path, sizeof(acq_path), "%s", tok + 13);
+        else if (!strncmp(tok, "fastboot.next=", 14))
+            snprintf(next_path, sizeof(next_path), "%s", tok + 14);
+        else if (!strncmp(tok, "fastboot.root=", 14))
+            snprintf(root_name, sizeof(root_name), "%s", tok + 14);
+        else if (!strncmp(tok, "fastboot.rootfstype=", 20))
+            snprintf(root_type, sizeof(root_type), "%s", tok + 20);
+        else if (!strncmp(tok, "fastboot.budget_ms=", 19))
+            budget_ms = strtol(tok + 19, NULL, 10);
+    }
+}
+
+static int load_module(const char *path)
+{
+    int fd, ret;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        log_msg("Error opening %s", path);
+        return -1;
+    }
+    ret = syscall(SYS_finit_module, fd, "", 0);
+    close(fd);
+    if (ret < 0)
+        log_msg("Error loading %s", path);
+    return ret;
+}
+
+/* Returns the kernel timestamp (us) of the probe message logged after the
+   current position of kmsg, or 0 if it was not found. The kmsg clock is
+   the scheduler clock, which matches CLOCK_BOOTTIME this early in boot */
+static long probe_time_us(int kmsg)
+{
+    char rec[256];
+    unsigned long ts;
+    ssize_t len;
+
+    while ((len = read(kmsg, rec, sizeof(rec) - 1)) > 0 || (len < 0 && errno == EPIPE))
+    {
+        char *msg;
+
+        if (len <= 0)
+            continue; // records were overwritten, keep reading
+        rec[len] = '\0';
+        msg = strchr(rec, ';');
+        if (msg && !strncmp(msg + 1, PROBE_MESSAGE, strlen(PROBE_MESSAGE)) &&
+            sscanf(rec, "%*u,%*u,%lu", &ts) == 1)
+            return ts;
+    }
+    return 0;
+}
+
+/* Waits for a device to be registered and creates its node from the
+   major:minor in sysfs */
+static int create_node(const char *sysfs_dev, const char *path, mode_t type)
+{
+    char buf[32];
+    unsigned int major, minor;
+    struct timespec delay = {0, 1000000}; // 1 ms
+    ssize_t len = -1;
+    int i, fd;
+
+    for (i = 0; i < PROBE_TIMEOUT_MS; i++)
+    {
+        fd = open(sysfs_dev, O_RDONLY);
+        if (fd >= 0)
+        {
+            len = read(fd, buf, sizeof(buf) - 1);
+            close(fd);
+            break;
+        }
+        nanosleep(&delay, NULL);
+    }
+    if (len <= 0)
+    {
+        log_msg("Error: %s not found", sysfs_dev);
+        return -1;
+    }
+    buf[len] = '\0';
+    if (sscanf(buf, "%u:%u", &major, &minor) != 2)
+    {
+        log_msg("Error parsing %s", sysfs_dev);
+        return -1;
+    }
+    if (mknod(path, type | 0600, makedev(major, minor)) < 0)
+    {
+        log_msg("Error creating %s", path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Mounts the full userland and makes it the root, keeping /proc, /sys,
+   /dev and /run. The initramfs content is not freed */
+static int switch_root(void)
+{
+    static const char *const keep[] = {"/proc", "/sys", "/dev", "/run"};
+    char sysfs_dev[64], dev[48], target[64];
+    unsigned int i;
+
+    snprintf(sysfs_dev, sizeof(sysfs_dev), "/sys/class/block/%s/dev", root_name);
+    snprintf(dev, sizeof(dev), "/dev/%s", root_name);
+    mkdir(NEW_ROOT, 0755);
+    if (create_node(sysfs_dev, dev, S_IFBLK) < 0 ||
+        mount(dev, NEW_ROOT, root_type, 0, NULL) < 0)
+    {
+        log_msg("Error mounting %s", dev);
+        return -1;
+    }
+    for (i = 0; i < sizeof(keep) / sizeof(keep[0]); i++)
+    {
+        snprintf(target, sizeof(target), NEW_ROOT "%s", keep[i]);
+        mkdir(target, 0755);
+        if (mount(keep[i], target, NULL, MS_MOVE, NULL) < 0)
+            log_msg("Error moving %s", keep[i]);
+    }
+    if (chdir(NEW_ROOT) < 0 || mount(".", "/", NULL, MS_MOVE, NULL) < 0 ||
+        chroot(".") < 0 || chdir("/") < 0)
+    {
+        log_msg("Error switching to %s", dev);
+        return -1;
+    }
+    return 0;
+}
+
+/* Reads one sample, giving up after SAMPLE_TIMEOUT_MS so that a sensor whose
+   interrupt never fires does not keep PID 1 from handing off */
+static int read_first_sample(void)
+{
+    struct pollfd pfd;
+    int16_t sample[3];
+    long deadline_us = boottime_us() + SAMPLE_TIMEOUT_MS * 1000L;
+    long left_us;
+    ssize_t len = -1;
+
+    pfd.fd = open(DEVICE_PATH, O_RDWR | O_NONBLOCK);
+    pfd.events = POLLIN;
+    if (pfd.fd < 0)
+    {
+        log_msg("Error opening %s", DEVICE_PATH);
+        return -1;
+    }
+    if (ioctl(pfd.fd, ADXL345_SET_AXIS, ADXL345_AXIS_ALL) < 0)
+    {
+        log_msg("Error configuring %s", DEVICE_PATH);
+        close(pfd.fd);
+        return -1;
+    }
+    while ((left_us = deadline_us - boottime_us()) > 0)
+    {
+        if (poll(&pfd, 1, (left_us + 999) / 1000) < 0 && errno != EINTR)
+            break;
+        len = read(pfd.fd, sample, sizeof(sample));
+        if (len >= 0 || errno != EAGAIN)
+            break;
+    }
+    close(pfd.fd);
+    if (len < (ssize_t)sizeof(sample))
+    {
+        if (left_us <= 0)
+            log_msg("Error: no sample from %s after %d ms", DEVICE_PATH, SAMPLE_TIMEOUT_MS);
+        else
+            log_msg("Error reading %s", DEVICE_PATH);
+        return -1;
+    }
+    log_msg("first sample x=%d y=%d z=%d", sample[0], sample[1], sample[2]);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    long start_us, probe_us, first_us = 0;
+    int kmsg_rd;
+
+    start_us = boottime_us();
+
+    /* Only what is needed to find the device: /proc for the command line,
+       /sys for its device number, a few static nodes in /dev, and what the
+       acquisition program uses: /dev/shm for shm_open, /run for its socket */
+    mkdir("/proc", 0555);
+    mkdir("/sys", 0555);
+    mkdir("/dev", 0755);
+    mkdir("/run", 0755);
+    mount("proc", "/proc", "proc", 0, NULL);
+    mount("sysfs", "/sys", "sysfs", 0, NULL);
+    mount("tmpfs", "/dev", "tmpfs", MS_NOSUID, "mode=0755");
+    mount("tmpfs", "/run", "tmpfs", MS_NOSUID | MS_NODEV, "mode=0755");
+    mkdir("/dev/shm", 01777);
+    mount("tmpfs", "/dev/shm", "tmpfs", MS_NOSUID | MS_NODEV, "mode=1777");
+    mknod("/dev/kmsg", S_IFCHR | 0600, makedev(1, 11));
+    kmsg_fd = open("/dev/kmsg", O_WRONLY | O_CLOEXEC);
+    kmsg_rd = open("/dev/kmsg", O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (kmsg_rd >= 0)
+        lseek(kmsg_rd, 0, SEEK_END);
+
+    parse_cmdline();
+    log_msg("%-14s %6ld.%03ld ms", "kernel", start_us / 1000, start_us % 1000);
+    last_us = start_us;
+    milestone("init");
+
+    if (load_module(module_path) == 0)
+    {
+        probe_us = kmsg_rd >= 0 ? probe_time_us(kmsg_rd) : 0;
+        if (probe_us)
+            milestone_at("probe", probe_us);
+        else
+            log_msg("probe time not found in kmsg");
+        milestone("module loaded");
+        if (create_node(SYSFS_DEV, DEVICE_PATH, S_IFCHR) == 0)
+        {
+            milestone("device node");
+            if (read_first_sample() == 0)
+                first_us = milestone("first sample");
+        }
+    }
+    if (kmsg_rd >= 0)
+        close(kmsg_rd);
+
+    if (budget_ms && first_us)
+    {
+        log_msg("time to first sample %ld ms, budget %ld ms: %s", first_us / 1000, budget_ms,
+                first_us / 1000 <= budget_ms ? "PASS" : "OVER BUDGET");
+    }
+    else if (budget_ms)
+    {
+        log_msg("time to first sample budget %ld ms: FAIL (no first sample)", budget_ms);
+    }
+
+    /* Hand off: acquisition keeps running while the full userland starts */
+    if (first_us && access(acq_path, X_OK) == 0)
+    {
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            execl(acq_path, acq_path, DEVICE_PATH, SOCKET_PATH, (char *)NULL);
+            _exit(1);
+        }
+        log_msg("started %s", acq_path);
+    }
+
+    if (root_name[0] && switch_root() == 0)
+        log_msg("switched to /dev/%s", root_name);
+    execv(next_path, argv);
+
+    log_msg("Error starting %s", next_path);
+    for (;;)
+        pause();
+}
+/*
+arm-linux-gnueabihf-gcc -Wall -O2 -static -I../pilote_i2c -o init init.c
+cp -a ../initramfs_busybox root && rm root/init && cp init root/init
+mkdir -p root/lib/modules && cp ../pilote_i2c/adxl345.ko root/lib/modules/ && cp ../pilote_i2c/adxl345d root/bin/
+sudo mknod root/dev/console c 5 1
+cd root && find . | cpio -o -H newc | gzip > ../fastboot.cpio.gz
+qemu-system-arm ... -initrd fastboot.cpio.gz -append "console=ttyAMA0 fastboot.budget_ms=500"
+*/
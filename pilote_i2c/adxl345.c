@@ -7,9 +7,20 @@
 #include <linux/fs.h>
 #include <linux/kfifo.h>
 #include <linux/wait.h>
+#include <linux/poll.h>
 #include <linux/sched.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+
+#include "adxl345.h"
 
 #define qsize (16)
+#define ADXL345_MAX_DEVICES (8)
+#define ADXL345_SETTLE_SAMPLES (32) // hardware FIFO depth, samples taken before a register change
 
 /* Count nb of times probe is called */
 uint8_t probe_nb = 0;
@@ -27,15 +38,35 @@ miscdevice field */
 struct adxl345_device {
     struct miscdevice miscdev;
     uint8_t option;
+    uint8_t index;
+    s8 offset[3]; // OFSX, OFSY, OFSZ, reapplied by adxl345_configure
+    struct mutex lock; // serializes calibration and self-test
+    spinlock_t fifo_lock; // producers (IRQ, replay timer) may also drop from the FIFO
     //DECLARE_KFIFO(fifo, struct fifo_element, qsize);
     DECLARE_KFIFO_PTR(fifo, struct fifo_element);
 };
 
+/* Offsets survive a remove/probe cycle of the same device number */
+static s8 saved_offsets[ADXL345_MAX_DEVICES][3];
+
+/* Store one sample in the internal FIFO, dropping the oldest one if it is full */
+static void adxl345_push(struct adxl345_device *device, struct fifo_element *element)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&device->fifo_lock, flags);
+    // fifo full, so take out oldest element and put back newest
+    if (kfifo_is_full(&device->fifo))
+        kfifo_skip(&device->fifo);
+    kfifo_in(&device->fifo, element, 1);
+    spin_unlock_irqrestore(&device->fifo_lock, flags);
+}
+
 static irqreturn_t adxl345_int(int irq, void *dev_id){
     struct adxl345_device *device = dev_id;
     struct i2c_client *client = to_i2c_client(device->miscdev.parent);
-    struct fifo_element element, element_foo;
-    int nb_samples, ret, i;
+    struct fifo_element element;
+    int nb_samples, i;
     char buf[1];
     buf[0] = 0x39;
     // pr_err("in interruption func\n");
@@ -69,26 +100,7 @@ static irqreturn_t adxl345_int(int irq, void *dev_id){
             pr_err("Error receiving FIFO_STATUS data\n");
             return -1;
         }
-        ret = kfifo_in(&device->fifo, &element, 1);
-        if (ret < 0)
-        {
-            pr_err("Error adding element to fifo\n");
-            return -1;
-        }
-        else if (ret == 0)
-        {
-            // fifo full, so take out oldest element and put back newest
-            if (!kfifo_out(&device->fifo, &element_foo, 1))
-            {
-                pr_err("Error getting element from fifo\n");
-                return -1;
-            }
-            if (!kfifo_in(&device->fifo, &element, 1))
-            {
-                pr_err("Error adding element to fifo\n");
-                return -1;
-            }
-        }
+        adxl345_push(device, &element);
     }
 
     // Reveillez les eventuels processus en attente de donnees
@@ -96,11 +108,284 @@ static irqreturn_t adxl345_int(int irq, void *dev_id){
     return IRQ_HANDLED;
 }
 
+static int adxl345_write_reg(struct i2c_client *client, u8 reg, u8 value)
+{
+    u8 buf[2] = {reg, value};
+
+    if (i2c_master_send(client, (char *)buf, 2) < 0)
+    {
+        pr_err("Error writing register 0x%x\n", reg);
+        return -1;
+    }
+    return 0;
+}
+
+static int adxl345_write_offsets(struct i2c_client *client, struct adxl345_device *device)
+{
+    /* OFSX, OFSY, OFSZ registers */
+    if (adxl345_write_reg(client, 0x1E, device->offset[0]) ||
+        adxl345_write_reg(client, 0x1F, device->offset[1]) ||
+        adxl345_write_reg(client, 0x20, device->offset[2]))
+    {
+        return -1;
+    }
+    if (device->index < ADXL345_MAX_DEVICES)
+        memcpy(saved_offsets[device->index], device->offset, sizeof(device->offset));
+    return 0;
+}
+
+/* Puts back the offsets in use before a failed update: in the device, in
+   saved_offsets for the next probe and resume, and in the registers */
+static void adxl345_restore_offsets(struct i2c_client *client, struct adxl345_device *device,
+                                    const s8 old[3])
+{
+    memcpy(device->offset, old, sizeof(device->offset));
+    if (device->index < ADXL345_MAX_DEVICES)
+        memcpy(saved_offsets[device->index], old, sizeof(device->offset));
+    if (adxl345_write_offsets(client, device))
+        pr_err("%s: failed to restore the offsets\n", device->miscdev.name);
+}
+
+/* Program the whole configuration, used on probe and resume */
+static int adxl345_configure(struct i2c_client *client, struct adxl345_device *device)
+{
+    char buf [2];
+
+    /* Output data rate: 100 Hz (output data rate, BW_RATE register) */
+    buf[0] = 0x2C;
+    buf[1] = 0x0A; // Normal operation, 100Hz output
+    
+    if (i2c_master_send(client, buf, 2) < 0) {
+        pr_err("Error sending BW_RATE data\n");
+        return -1;
+    }
+
+    /* watermarks interrupts enabled (INT_ENABLE register) */
+    buf[0] = 0x2E;
+    buf[1] = 0x02; // watermark interrupts enabled
+
+    if (i2c_master_send(client, buf, 2) < 0) {
+        pr_err("Error sending INT_ENABLE data\n");
+        return -1;
+    }
+
+    /* Default data format (DATA_FORMAT register) */
+    buf[0] = 0x31;
+    buf[1] = 0x00; // Default data format
+
+    if (i2c_master_send(client, buf, 2) < 0) {
+        pr_err("Error sending DATA_FORMAT data\n");
+        return -1;
+    }
+
+    /* Calibrated offsets, applied by the sensor to every sample */
+    if (adxl345_write_offsets(client, device)) {
+        pr_err("Error sending OFS data\n");
+        return -1;
+    }
+
+    /* FIFO stream (stream mode, FIFO_CTL register) */
+    buf[0] = 0x38;
+    buf[1] = 0x54; // FIFO stream mode
+
+    if (i2c_master_send(client, buf, 2) < 0) {
+        pr_err("Error sending FIFO_CTL data\n");
+        return -1;
+    }
+
+    /* Measurement mode activated (POWER_CTL register) */
+    buf[0] = 0x2D;
+    buf[1] = 0x08; // Measurement mode activated
+
+    if (i2c_master_send(client, buf, 2) < 0) {
+        pr_err("Error sending POWER_CTL data\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Average nb samples taken from the internal FIFO, avg may be NULL to
+   just drop them */
+static int adxl345_average(struct adxl345_device *device, unsigned int nb, s32 avg[3])
+{
+    struct fifo_element element;
+    s32 sum[3] = {0, 0, 0};
+    unsigned int i = 0;
+
+    while (i < nb)
+    {
+        if (wait_event_interruptible(queue_, (!kfifo_is_empty(&device->fifo))))
+            return -ERESTARTSYS;
+        // Another reader may have taken the sample first
+        if (!kfifo_out_spinlocked(&device->fifo, &element, 1, &device->fifo_lock))
+            continue;
+        sum[0] += element.x;
+        sum[1] += element.y;
+        sum[2] += element.z;
+        i++;
+    }
+    if (avg)
+    {
+        avg[0] = DIV_ROUND_CLOSEST(sum[0], (s32)nb);
+        avg[1] = DIV_ROUND_CLOSEST(sum[1], (s32)nb);
+        avg[2] = DIV_ROUND_CLOSEST(sum[2], (s32)nb);
+    }
+    return 0;
+}
+
+static int adxl345_calibrate(struct adxl345_device *device, struct adxl345_calibration *calib)
+{
+    struct i2c_client *client = to_i2c_client(device->miscdev.parent);
+    /* Expected output at rest, flat: 0 g, 0 g, +1 g (256 LSB/g at +-2 g, 10 bit) */
+    static const s32 target[3] = {0, 0, 256};
+    s32 avg[3];
+    s8 old[3];
+    int i, err;
+
+    if (calib->nb_samples == 0 || calib->nb_samples > ADXL345_MAX_AVERAGE)
+        return -EINVAL;
+
+    // Measure the raw bias, dropping the samples taken with the old offsets
+    memcpy(old, device->offset, sizeof(old));
+    memset(device->offset, 0, sizeof(device->offset));
+    err = adxl345_write_offsets(client, device) ? -EIO : 0;
+    if (!err)
+        err = adxl345_average(device, ADXL345_SETTLE_SAMPLES + qsize, NULL);
+    if (!err)
+        err = adxl345_average(device, calib->nb_samples, avg);
+    if (err)
+        goto restore;
+
+    // One offset LSB is 15.6 mg, 4 times the data LSB
+    for (i = 0; i < 3; i++)
+        device->offset[i] = clamp(DIV_ROUND_CLOSEST(target[i] - avg[i], 4), -128, 127);
+    if (adxl345_write_offsets(client, device)) {
+        err = -EIO;
+        goto restore;
+    }
+
+    memcpy(calib->offset, device->offset, sizeof(device->offset));
+    pr_info("%s calibrated, offsets %d %d %d\n", device->miscdev.name,
+            device->offset[0], device->offset[1], device->offset[2]);
+    return 0;
+
+restore:
+    // Keep the previous calibration
+    adxl345_restore_offsets(client, device, old);
+    return err;
+}
+
+static int adxl345_self_test(struct adxl345_device *device, struct adxl345_self_test *test)
+{
+    struct i2c_client *client = to_i2c_client(device->miscdev.parent);
+    /* Datasheet limits in LSB for +-2 g, 10 bit (VS = 2.5 V) */
+    static const s32 min[3] = {50, -540, 75};
+    static const s32 max[3] = {540, -50, 875};
+    s32 off[3], on[3];
+    int i, err;
+
+    if (test->nb_samples == 0 || test->nb_samples > ADXL345_MAX_AVERAGE)
+        return -EINVAL;
+
+    err = adxl345_average(device, test->nb_samples, off);
+    if (err)
+        return err;
+
+    /* Self-test force on (SELF_TEST bit of DATA_FORMAT register) */
+    if (adxl345_write_reg(client, 0x31, 0x80))
+        return -EIO;
+    err = adxl345_average(device, ADXL345_SETTLE_SAMPLES + qsize, NULL);
+    if (!err)
+        err = adxl345_average(device, test->nb_samples, on);
+
+    /* Back to the default data format, even if interrupted */
+    if (adxl345_write_reg(client, 0x31, 0x00))
+        return -EIO;
+    if (err)
+        return err;
+    err = adxl345_average(device, ADXL345_SETTLE_SAMPLES + qsize, NULL);
+    if (err)
+        return err;
+
+    test->passed = 1;
+    for (i = 0; i < 3; i++)
+    {
+        test->delta[i] = on[i] - off[i];
+        if (test->delta[i] < min[i] || test->delta[i] > max[i])
+            test->passed = 0;
+    }
+    pr_info("%s self-test %s, deltas %d %d %d\n", device->miscdev.name,
+            test->passed ? "passed" : "failed", test->delta[0], test->delta[1], test->delta[2]);
+    return 0;
+}
+
+/* Calibration and self-test commands, only for devices backed by a sensor */
+static long adxl345_ioctl_sensor(struct adxl345_device *device, unsigned int cmd, void __user *argp)
+{
+    struct adxl345_calibration calib;
+    struct adxl345_self_test test;
+    s8 offset[3], old[3];
+    long ret = 0;
+
+    if (!device->miscdev.parent)
+        return -ENOTTY;
+
+    mutex_lock(&device->lock);
+    switch (cmd)
+    {
+    case ADXL345_CALIBRATE:
+        if (copy_from_user(&calib, argp, sizeof(calib)))
+        {
+            ret = -EFAULT;
+            break;
+        }
+        ret = adxl345_calibrate(device, &calib);
+        if (!ret && copy_to_user(argp, &calib, sizeof(calib)))
+            ret = -EFAULT;
+        break;
+    case ADXL345_GET_OFFSETS:
+        if (copy_to_user(argp, device->offset, sizeof(device->offset)))
+            ret = -EFAULT;
+        break;
+    case ADXL345_SET_OFFSETS:
+        if (copy_from_user(offset, argp, sizeof(offset)))
+        {
+            ret = -EFAULT;
+            break;
+        }
+        memcpy(old, device->offset, sizeof(old));
+        memcpy(device->offset, offset, sizeof(offset));
+        if (adxl345_write_offsets(to_i2c_client(device->miscdev.parent), device))
+        {
+            adxl345_restore_offsets(to_i2c_client(device->miscdev.parent), device, old);
+            ret = -EIO;
+        }
+        break;
+    case ADXL345_SELF_TEST:
+        if (copy_from_user(&test, argp, sizeof(test)))
+        {
+            ret = -EFAULT;
+            break;
+        }
+        ret = adxl345_self_test(device, &test);
+        if (!ret && copy_to_user(argp, &test, sizeof(test)))
+            ret = -EFAULT;
+        break;
+    default:
+        ret = -ENOTTY;
+        break;
+    }
+    mutex_unlock(&device->lock);
+    return ret;
+}
+
 long adxl345_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
     struct adxl345_device *device = container_of(file->private_data, struct adxl345_device, miscdev);
     //struct i2c_client *client = to_i2c_client(device->mdev.parent);
-    pr_err("IOCTL");
+    pr_debug("IOCTL");
+    if (cmd != ADXL345_SET_AXIS)
+        return adxl345_ioctl_sensor(device, cmd, (void __user *)arg);
     /*let the application chose if we want to chose axis x, y or z*/
     switch (arg)
     {
@@ -116,6 +401,10 @@ long adxl345_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
         // Z axis
         device->option = 2;
         break;
+    case 3:
+        // All axis, reads return as many samples as fit in the buffer
+        device->option = 3;
+        break;
     default:
         pr_err("Error: invalid option\n");
         break;
@@ -129,6 +418,15 @@ ssize_t adxl345_read(struct file *filp, char __user *buf, size_t count, loff_t *
     // struct i2c_client *client = to_i2c_client(device->mdev.parent);
     // char buf_l;
     struct fifo_element element;
+    struct fifo_element batch[qsize];
+    size_t nb_elements = 0;
+
+    // All axis mode returns whole samples, never less than one
+    if (device->option == 3 && count < sizeof(struct fifo_element))
+        return -EINVAL;
+
+    if ((filp->f_flags & O_NONBLOCK) && kfifo_is_empty(&device->fifo))
+        return -EAGAIN;
 
     // Si non, mettez le processus en attente
     if (wait_event_interruptible(queue_, (!kfifo_is_empty(&device->fifo))))
@@ -139,7 +437,7 @@ ssize_t adxl345_read(struct file *filp, char __user *buf, size_t count, loff_t *
 
     // Renvoyez les donnees depuis la FIFO interne
 
-    if (!kfifo_out(&device->fifo, &element, 1))
+    if (!kfifo_out_spinlocked(&device->fifo, &element, 1, &device->fifo_lock))
     {
         pr_err("Error getting element from fifo\n");
         return -1;
@@ -148,55 +446,297 @@ ssize_t adxl345_read(struct file *filp, char __user *buf, size_t count, loff_t *
     switch (device->option)
     {
     case 0:
-        pr_err("X axis");
+        pr_debug("X axis");
         if (copy_to_user(buf, &(element.x), 2))
         {
             pr_err("Error copying data to user\n");
             return -1;
         }
-        pr_err("2 bytes of data have been sent to user");
+        pr_debug("2 bytes of data have been sent to user");
         break;
     case 1:
-        pr_err("Y axis");
+        pr_debug("Y axis");
         if (copy_to_user(buf, &(element.y), 2))
         {
             pr_err("Error copying data to user\n");
             return -1;
         }
-        pr_err("2 bytes of data have been sent to user");
+        pr_debug("2 bytes of data have been sent to user");
         break;
     case 2:
-        pr_err("Z axis");
+        pr_debug("Z axis");
         if (copy_to_user(buf, &(element.z), 2))
         {
             pr_err("Error copying data to user\n");
             return -1;
         }
-        pr_err("2 bytes of data have been sent to user");
+        pr_debug("2 bytes of data have been sent to user");
         break;
     case 3:
-        pr_err("ALL axis");
-        if (copy_to_user(buf, &(element), 6))
+        // Drain up to qsize samples in one call so streaming consumers
+        // do not pay one syscall per sample
+        batch[0] = element;
+        nb_elements = min_t(size_t, count / sizeof(struct fifo_element), qsize);
+        if (nb_elements > 1)
+            nb_elements = 1 + kfifo_out_spinlocked(&device->fifo, &batch[1], nb_elements - 1,
+                                                   &device->fifo_lock);
+        else
+            nb_elements = 1;
+        if (copy_to_user(buf, batch, nb_elements * sizeof(struct fifo_element)))
         {
             pr_err("Error copying data to user\n");
             return -1;
         }
-        pr_err("2 bytes of data have been sent to user");
         break;
     default:
         pr_err("Error: invalid option\n");
         break;
     }
 
-    pr_err("Read function\n");
-    pr_err("data remaining in fifo: %d\n", kfifo_len(&device->fifo));
-    return (device->option == 3) ? 6 : 2;
+    pr_debug("Read function\n");
+    pr_debug("data remaining in fifo: %d\n", kfifo_len(&device->fifo));
+    return (device->option == 3) ? nb_elements * sizeof(struct fifo_element) : 2;
 }   
 
+/* Lets readers wait for a sample with a timeout */
+__poll_t adxl345_poll(struct file *filp, poll_table *wait)
+{
+    struct adxl345_device *device = container_of(filp->private_data, struct adxl345_device, miscdev);
+
+    poll_wait(filp, &queue_, wait);
+    return kfifo_is_empty(&device->fifo) ? 0 : EPOLLIN | EPOLLRDNORM;
+}
+
 static const struct file_operations adxl345_fops = {
     .owner = THIS_MODULE,
     .unlocked_ioctl = adxl345_ioctl,
-    .read = adxl345_read};
+    .read = adxl345_read,
+    .poll = adxl345_poll};
+
+/* Replay device: a virtual accelerometer fed from user space */
+#define REPLAY_QSIZE (4096)
+#define REPLAY_ODR_NS (10 * NSEC_PER_MSEC) // 100Hz, same as BW_RATE on the real device
+#define REPLAY_FAST_NS (20 * NSEC_PER_USEC) // tick period when replaying as fast as possible
+
+static bool replay;
+module_param(replay, bool, 0444);
+MODULE_PARM_DESC(replay, "Register /dev/adxl345-replay fed by writes instead of the sensor");
+
+struct adxl345_replay {
+    struct adxl345_device device;
+    DECLARE_KFIFO_PTR(feed, struct fifo_element); // samples written, not yet delivered
+    wait_queue_head_t space;
+    struct mutex write_lock;
+    struct hrtimer timer;
+    spinlock_t lock; // protects the fields below
+    bool running;
+    unsigned int scale;
+    unsigned int burst;
+    unsigned int gap;
+    unsigned int overrun;
+};
+
+static struct adxl345_replay *replay_device;
+
+static enum hrtimer_restart adxl345_replay_tick(struct hrtimer *timer)
+{
+    struct adxl345_replay *r = container_of(timer, struct adxl345_replay, timer);
+    struct fifo_element element;
+    unsigned int nb = 1, pushed = 0;
+    unsigned long flags;
+    bool restart;
+
+    spin_lock_irqsave(&r->lock, flags);
+
+    // Samples lost by the "sensor" are dropped before reaching the internal FIFO
+    while (r->overrun && kfifo_out(&r->feed, &element, 1))
+        r->overrun--;
+
+    if (r->gap)
+    {
+        r->gap--;
+        nb = 0;
+    }
+    else if (r->burst)
+    {
+        // Only what fits in the internal FIFO, the rest of the burst goes
+        // out on the next ticks as readers make room
+        nb = min_t(unsigned int, r->burst, kfifo_avail(&r->device.fifo));
+        r->burst -= nb;
+    }
+    else if (r->scale == 0)
+    {
+        // As fast as possible: fill the internal FIFO without overwriting
+        nb = kfifo_avail(&r->device.fifo);
+    }
+
+    for (; pushed < nb && kfifo_out(&r->feed, &element, 1); pushed++)
+        adxl345_push(&r->device, &element);
+
+    // As fast as possible only means as fast as readers drain: the timer
+    // stops while the internal FIFO is full and reads start it again
+    restart = r->gap || (!kfifo_is_empty(&r->feed) &&
+                         (r->scale || kfifo_avail(&r->device.fifo)));
+    r->running = restart;
+    if (restart)
+        hrtimer_forward_now(timer, ns_to_ktime(r->scale ? REPLAY_ODR_NS / r->scale : REPLAY_FAST_NS));
+
+    spin_unlock_irqrestore(&r->lock, flags);
+
+    // queue_ is shared with the sensors, only wake it for new samples
+    if (pushed)
+        wake_up(&queue_);
+    wake_up(&r->space);
+    return restart ? HRTIMER_RESTART : HRTIMER_NORESTART;
+}
+
+static void adxl345_replay_kick(struct adxl345_replay *r)
+{
+    unsigned long flags;
+
+    spin_lock_irqsave(&r->lock, flags);
+    if (!r->running)
+    {
+        r->running = true;
+        hrtimer_start(&r->timer, ns_to_ktime(r->scale ? REPLAY_ODR_NS / r->scale : REPLAY_FAST_NS),
+                      HRTIMER_MODE_REL_SOFT);
+    }
+    spin_unlock_irqrestore(&r->lock, flags);
+}
+
+ssize_t adxl345_replay_write(struct file *filp, const char __user *buf, size_t count, loff_t *f_pos)
+{
+    struct adxl345_replay *r = container_of(filp->private_data, struct adxl345_replay, device.miscdev);
+    unsigned int copied;
+    int ret;
+
+    count -= count % sizeof(struct fifo_element);
+    if (count == 0)
+        return -EINVAL;
+
+    // Wait until the feed can take at least one sample
+    if (wait_event_interruptible(r->space, !kfifo_is_full(&r->feed)))
+        return -ERESTARTSYS;
+
+    mutex_lock(&r->write_lock);
+    ret = kfifo_from_user(&r->feed, buf, count, &copied);
+    mutex_unlock(&r->write_lock);
+    if (ret)
+        return ret;
+
+    adxl345_replay_kick(r);
+    return copied;
+}
+
+ssize_t adxl345_replay_read(struct file *filp, char __user *buf, size_t count, loff_t *f_pos)
+{
+    struct adxl345_replay *r = container_of(filp->private_data, struct adxl345_replay, device.miscdev);
+    ssize_t ret = adxl345_read(filp, buf, count, f_pos);
+
+    // Room was made in the internal FIFO, resume a stopped playback
+    if (ret > 0 && !kfifo_is_empty(&r->feed))
+        adxl345_replay_kick(r);
+    return ret;
+}
+
+long adxl345_replay_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    struct adxl345_replay *r = container_of(file->private_data, struct adxl345_replay, device.miscdev);
+    unsigned long flags;
+
+    spin_lock_irqsave(&r->lock, flags);
+    switch (cmd)
+    {
+    case ADXL345_REPLAY_SCALE:
+        r->scale = arg;
+        break;
+    case ADXL345_REPLAY_BURST:
+        r->burst = arg;
+        break;
+    case ADXL345_REPLAY_GAP:
+        r->gap = arg;
+        break;
+    case ADXL345_REPLAY_OVERRUN:
+        r->overrun = arg;
+        break;
+    default:
+        spin_unlock_irqrestore(&r->lock, flags);
+        return adxl345_ioctl(file, cmd, arg);
+    }
+    spin_unlock_irqrestore(&r->lock, flags);
+
+    adxl345_replay_kick(r);
+    return 0;
+}
+
+static const struct file_operations adxl345_replay_fops = {
+    .owner = THIS_MODULE,
+    .unlocked_ioctl = adxl345_replay_ioctl,
+    .read = adxl345_replay_read,
+    .poll = adxl345_poll,
+    .write = adxl345_replay_write};
+
+static int adxl345_replay_create(void)
+{
+    struct adxl345_replay *r;
+
+    r = kzalloc(sizeof(struct adxl345_replay), GFP_KERNEL);
+    if (!r)
+    {
+        pr_err("Error allocating memory for replay device\n");
+        return -ENOMEM;
+    }
+    if (kfifo_alloc(&r->device.fifo, qsize, GFP_KERNEL))
+    {
+        pr_err("Error allocating fifo\n");
+        kfree(r);
+        return -ENOMEM;
+    }
+    if (kfifo_alloc(&r->feed, REPLAY_QSIZE, GFP_KERNEL))
+    {
+        pr_err("Error allocating replay feed\n");
+        kfifo_free(&r->device.fifo);
+        kfree(r);
+        return -ENOMEM;
+    }
+    init_waitqueue_head(&r->space);
+    mutex_init(&r->write_lock);
+    spin_lock_init(&r->device.fifo_lock);
+    spin_lock_init(&r->lock);
+    hrtimer_init(&r->timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+    r->timer.function = adxl345_replay_tick;
+    r->scale = 1;
+
+    r->device.miscdev.minor = MISC_DYNAMIC_MINOR;
+    r->device.miscdev.name = "adxl345-replay";
+    r->device.miscdev.fops = &adxl345_replay_fops;
+    if (misc_register(&r->device.miscdev))
+    {
+        pr_err("Error registering replay device\n");
+        kfifo_free(&r->feed);
+        kfifo_free(&r->device.fifo);
+        kfree(r);
+        return -1;
+    }
+
+    replay_device = r;
+    pr_err("ADXL345 replay device initialized\n");
+    return 0;
+}
+
+static void adxl345_replay_destroy(void)
+{
+    struct adxl345_replay *r = replay_device;
+
+    if (!r)
+        return;
+    misc_deregister(&r->device.miscdev);
+    hrtimer_cancel(&r->timer);
+    kfifo_free(&r->feed);
+    kfifo_free(&r->device.fifo);
+    kfree(r);
+    replay_device = NULL;
+}
 
 static int adxl345_probe(struct i2c_client *client,
                 const struct i2c_device_id *id)
@@ -207,7 +747,7 @@ static int adxl345_probe(struct i2c_client *client,
     /* Dynamically allocate memory for an instance of the struct adxl345_device */
     struct adxl345_device *adxl345;
     /* Allocate memory for the adxl345 device */
-    adxl345 = kmalloc(sizeof(struct adxl345_device), GFP_KERNEL);
+    adxl345 = kzalloc(sizeof(struct adxl345_device), GFP_KERNEL);
     if (!adxl345) {
         pr_err("Error allocating memory for adxl345 device\n");
         return -ENOMEM;
@@ -221,6 +761,11 @@ static int adxl345_probe(struct i2c_client *client,
         pr_err("Error allocation failure\n");
         return -ENOMEM;
     }
+    adxl345->index = probe_nb;
+    if (adxl345->index < ADXL345_MAX_DEVICES)
+        memcpy(adxl345->offset, saved_offsets[adxl345->index], sizeof(adxl345->offset));
+    mutex_init(&adxl345->lock);
+    spin_lock_init(&adxl345->fifo_lock);
     /* Increment nb times probe is called */
     probe_nb++;
 
@@ -235,50 +780,8 @@ static int adxl345_probe(struct i2c_client *client,
     }
     pr_err("DEVID register value: 0x%x\n", buf[0]);
 
-    /* Output data rate: 100 Hz (output data rate, BW_RATE register) */
-    buf[0] = 0x2C;
-    buf[1] = 0x0A; // Normal operation, 100Hz output
-    
-    if (i2c_master_send(client, buf, 2) < 0) {
-        pr_err("Error sending BW_RATE data\n");
-        return -1;
-    }
-
-    /* watermarks interrupts enabled (INT_ENABLE register) */
-    buf[0] = 0x2E;
-    buf[1] = 0x02; // watermark interrupts enabled
-
-    if (i2c_master_send(client, buf, 2) < 0) {
-        pr_err("Error sending INT_ENABLE data\n");
+    if (adxl345_configure(client, adxl345))
         return -1;
-    }
-
-    /* Default data format (DATA_FORMAT register) */
-    buf[0] = 0x31;
-    buf[1] = 0x00; // Default data format
-
-    if (i2c_master_send(client, buf, 2) < 0) {
-        pr_err("Error sending DATA_FORMAT data\n");
-        return -1;
-    }
-
-    /* FIFO stream (stream mode, FIFO_CTL register) */
-    buf[0] = 0x38;
-    buf[1] = 0x54; // FIFO stream mode
-
-    if (i2c_master_send(client, buf, 2) < 0) {
-        pr_err("Error sending FIFO_CTL data\n");
-        return -1;
-    }
-
-    /* Measurement mode activated (POWER_CTL register) */
-    buf[0] = 0x2D;
-    buf[1] = 0x08; // Measurement mode activated
-
-    if (i2c_master_send(client, buf, 2) < 0) {
-        pr_err("Error sending POWER_CTL data\n");
-        return -1;
-    }
 
     /* Fill miscdevice structure of adxl345_device */
     adxl345->miscdev.minor = MISC_DYNAMIC_MINOR;
@@ -345,6 +848,23 @@ static int adxl345_remove(struct i2c_client *client)
 
     return 0;
 }
+/* The sensor may lose its registers while suspended, reprogram everything
+   (including the calibrated offsets) on resume */
+static int __maybe_unused adxl345_suspend(struct device *dev)
+{
+    /* Standby mode (POWER_CTL register) */
+    return adxl345_write_reg(to_i2c_client(dev), 0x2D, 0x00) ? -EIO : 0;
+}
+
+static int __maybe_unused adxl345_resume(struct device *dev)
+{
+    struct i2c_client *client = to_i2c_client(dev);
+
+    return adxl345_configure(client, i2c_get_clientdata(client)) ? -EIO : 0;
+}
+
+static SIMPLE_DEV_PM_OPS(adxl345_pm_ops, adxl345_suspend, adxl345_resume);
+
 /* The following list allows the association between a device and its driver
 driver in the case of a static initialization without using
 device tree.
@@ -379,13 +899,37 @@ static struct i2c_driver adxl345_driver = {
         and must not contain spaces. */
         .name = "qemu,adxl345",
         .of_match_table = of_match_ptr(adxl345_of_match),
+        .pm = &adxl345_pm_ops,
     },
         .id_table = adxl345_idtable,
         .probe = adxl345_probe,
         .remove = adxl345_remove,
 };
 
-module_i2c_driver(adxl345_driver);
+static int __init adxl345_init(void)
+{
+    int err;
+
+    if (replay)
+    {
+        err = adxl345_replay_create();
+        if (err)
+            return err;
+    }
+    err = i2c_add_driver(&adxl345_driver);
+    if (err)
+        adxl345_replay_destroy();
+    return err;
+}
+
+static void __exit adxl345_exit(void)
+{
+    i2c_del_driver(&adxl345_driver);
+    adxl345_replay_destroy();
+}
+
+module_init(adxl345_init);
+module_exit(adxl345_exit);
 
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("adxl345 driver");
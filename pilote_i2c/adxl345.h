@@ -0,0 +1,63 @@
+#ifndef ADXL345_H
+#define ADXL345_H
+
+/* ioctl interface of /dev/adxl345-N, shared by the driver and the applications */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* Command 0 selects what read returns, arg is one of the values below */
+#define ADXL345_SET_AXIS 0
+#define ADXL345_AXIS_X 0   // 2 bytes per read
+#define ADXL345_AXIS_Y 1   // 2 bytes per read
+#define ADXL345_AXIS_Z 2   // 2 bytes per read
+#define ADXL345_AXIS_ALL 3 // 6 bytes per sample, several samples per read
+
+/*
+ * Replay device (/dev/adxl345-replay, module parameter replay=1).
+ * Samples written to the device (6 bytes each, x y z little-endian) are
+ * delivered to readers at the 100 Hz output data rate times the scale.
+ */
+#define ADXL345_IOC_MAGIC 'x'
+/* arg: speed multiplier, 1 = real time, 0 = as fast as readers drain */
+#define ADXL345_REPLAY_SCALE _IO(ADXL345_IOC_MAGIC, 1)
+/* arg: number of samples delivered at once on the next tick, limited to the
+   free space of the 16 sample internal FIFO; the rest follows on the next
+   ticks as readers make room */
+#define ADXL345_REPLAY_BURST _IO(ADXL345_IOC_MAGIC, 2)
+/* arg: number of ticks without any sample delivered */
+#define ADXL345_REPLAY_GAP _IO(ADXL345_IOC_MAGIC, 3)
+/* arg: number of samples discarded as if lost by the sensor */
+#define ADXL345_REPLAY_OVERRUN _IO(ADXL345_IOC_MAGIC, 4)
+
+/*
+ * Offset calibration and self-test (real devices only), the sensor must be
+ * at rest, flat with Z up. Both consume samples from the device, so other
+ * readers should be stopped meanwhile.
+ * Calibration averages nb_samples samples, then programs the OFSX/OFSY/OFSZ
+ * registers so that reads return 0, 0, +1 g; the offsets are kept and
+ * reapplied on probe and resume. Offsets are in 15.6 mg units (4 LSB of
+ * the default +-2 g data format).
+ */
+struct adxl345_calibration
+{
+    __u32 nb_samples; // in, 1..ADXL345_MAX_AVERAGE
+    __s8 offset[3];   // out, programmed offsets x y z
+};
+
+/* Self-test: average output change with the SELF_TEST bit set, checked
+   against the datasheet limits for +-2 g, 10 bit */
+struct adxl345_self_test
+{
+    __u32 nb_samples; // in, 1..ADXL345_MAX_AVERAGE
+    __s16 delta[3];   // out, x y z output change in LSB
+    __u32 passed;     // out, 1 if all axis are within limits
+};
+
+#define ADXL345_MAX_AVERAGE 1024
+#define ADXL345_CALIBRATE _IOWR(ADXL345_IOC_MAGIC, 5, struct adxl345_calibration)
+#define ADXL345_GET_OFFSETS _IOR(ADXL345_IOC_MAGIC, 6, __s8[3])
+#define ADXL345_SET_OFFSETS _IOW(ADXL345_IOC_MAGIC, 7, __s8[3])
+#define ADXL345_SELF_TEST _IOWR(ADXL345_IOC_MAGIC, 8, struct adxl345_self_test)
+
+#endif
@@ -0,0 +1,237 @@
+#ifndef ADXL345_RING_H
+#define ADXL345_RING_H
+
+/*
+ * Shared memory broadcast ring published by adxl345d.
+ *
+ * The daemon is the only writer: it announces the samples it is about to
+ * overwrite by advancing write_end, stores them in samples[n % RING_SLOTS]
+ * and then advances head. Clients map the ring read-only, so none of them
+ * can corrupt the stream for the others.
+ *
+ * Every client gets its own small writable page (struct ring_client)
+ * holding its cursor, so any number of readers see the full stream. A
+ * client that falls more than RING_SLOTS samples behind is lapped: it skips
+ * ahead to the oldest sample still in the ring and is told how many samples
+ * it lost. head doubles as a futex word, blocked readers set their waiting
+ * flag and are woken on publish.
+ *
+ * Clients connect to the daemon's UNIX socket and receive the ring fd and
+ * their client page fd; closing the socket releases the slot.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RING_SOCKET_PATH "/tmp/adxl345-0.sock"
+#define RING_MAGIC 0x41584c52 // "AXLR"
+#define RING_SLOTS 4096       // power of two, ~40 s at 100 Hz
+#define RING_INITIAL_CLIENTS 16 // the daemon grows its client table as needed
+
+struct ring_sample
+{
+    int16_t x;
+    int16_t y;
+    int16_t z;
+};
+
+/* Read-only for clients */
+struct adxl345_ring
+{
+    uint32_t magic;
+    uint32_t slots;
+    uint32_t write_end; // head + samples being written, slots before it may be overwritten
+    uint32_t head;      // samples published so far (wraps), futex word
+    struct ring_sample samples[RING_SLOTS];
+};
+
+/* One per client, writable by that client and by the daemon */
+struct ring_client
+{
+    uint32_t cursor;  // next sample the client will read
+    uint32_t dropped; // samples lost by this client so far
+    uint32_t waiting; // set while the client is blocked on head
+};
+
+/* Message sent by the daemon along with the ring and client fds (SCM_RIGHTS) */
+struct ring_attach_msg
+{
+    int32_t slot; // -1 if the daemon could not set up the client, no fd is sent then
+};
+
+struct ring_reader
+{
+    int sock;
+    const struct adxl345_ring *ring;
+    struct ring_client *client;
+};
+
+static inline int ring_futex(const uint32_t *addr, int op, uint32_t val)
+{
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+/* Daemon side: publish nb samples (nb <= RING_SLOTS), the caller wakes the
+   clients that are waiting */
+static inline void ring_publish(struct adxl345_ring *ring, const struct ring_sample *s, size_t nb)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    size_t i;
+
+    /* Readers check write_end after copying, so they notice slots that are
+       being rewritten and not only the ones already published */
+    __atomic_store_n(&ring->write_end, head + nb, __ATOMIC_SEQ_CST);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (i = 0; i < nb; i++)
+        ring->samples[(head + i) & (RING_SLOTS - 1)] = s[i];
+    __atomic_store_n(&ring->head, head + nb, __ATOMIC_SEQ_CST);
+}
+
+/* Client side: connect to the daemon and map the ring, returns 0 on success */
+static inline int ring_attach(const char *path, struct ring_reader *r)
+{
+    struct sockaddr_un addr;
+    struct ring_attach_msg msg;
+    struct iovec iov = {&msg, sizeof(msg)};
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct msghdr hdr;
+    struct cmsghdr *cmsg;
+    int fds[2] = {-1, -1};
+    void *p;
+
+    memset(r, 0, sizeof(*r));
+    r->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (r->sock < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(r->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        goto err;
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    if (recvmsg(r->sock, &hdr, 0) != sizeof(msg) || msg.slot < 0)
+        goto err;
+    for (cmsg = CMSG_FIRSTHDR(&hdr); cmsg; cmsg = CMSG_NXTHDR(&hdr, cmsg))
+    {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int)))
+            memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+    }
+    if (fds[0] < 0 || fds[1] < 0)
+        goto err;
+
+    p = mmap(NULL, sizeof(struct adxl345_ring), PROT_READ, MAP_SHARED, fds[0], 0);
+    if (p == MAP_FAILED)
+        goto err;
+    r->ring = p;
+    p = mmap(NULL, sizeof(struct ring_client), PROT_READ | PROT_WRITE, MAP_SHARED, fds[1], 0);
+    if (p == MAP_FAILED)
+        goto err;
+    r->client = p;
+    close(fds[0]);
+    close(fds[1]);
+
+    if (r->ring->magic != RING_MAGIC || r->ring->slots != RING_SLOTS)
+        goto err;
+    return 0;
+
+err:
+    if (fds[0] >= 0)
+        close(fds[0]);
+    if (fds[1] >= 0)
+        close(fds[1]);
+    if (r->ring)
+        munmap((void *)r->ring, sizeof(struct adxl345_ring));
+    if (r->client)
+        munmap(r->client, sizeof(struct ring_client));
+    close(r->sock);
+    memset(r, 0, sizeof(*r));
+    r->sock = -1;
+    return -1;
+}
+
+static inline void ring_detach(struct ring_reader *r)
+{
+    if (r->ring)
+        munmap((void *)r->ring, sizeof(struct adxl345_ring));
+    if (r->client)
+        munmap(r->client, sizeof(struct ring_client));
+    if (r->sock >= 0)
+        close(r->sock);
+    r->ring = NULL;
+    r->client = NULL;
+    r->sock = -1;
+}
+
+/*
+ * Client side: copy up to max samples, blocking while none are available.
+ * Samples lost because the client was lapped are added to *dropped.
+ * Returns the number of samples copied, which may be 0 if all of them were
+ * overwritten during the copy.
+ */
+static inline size_t ring_read(struct ring_reader *r, struct ring_sample *out, size_t max,
+                               uint32_t *dropped)
+{
+    const struct adxl345_ring *ring = r->ring;
+    uint32_t cursor = r->client->cursor;
+    uint32_t head, end, avail, lost = 0;
+    size_t i, nb, copied;
+
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    while (head == cursor)
+    {
+        __atomic_store_n(&r->client->waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) == cursor)
+            ring_futex(&ring->head, FUTEX_WAIT, cursor);
+        __atomic_store_n(&r->client->waiting, 0, __ATOMIC_RELAXED);
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    }
+
+    avail = head - cursor;
+    if (avail > RING_SLOTS)
+    {
+        lost = avail - RING_SLOTS;
+        cursor += lost;
+        avail = RING_SLOTS;
+    }
+    nb = avail < max ? avail : max;
+    for (i = 0; i < nb; i++)
+        out[i] = ring->samples[(cursor + i) & (RING_SLOTS - 1)];
+    copied = nb;
+
+    /* Slots the writer reserved (write_end) while we copied may hold a mix
+       of old and new data, drop them */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    end = __atomic_load_n(&ring->write_end, __ATOMIC_RELAXED);
+    if (end - cursor > RING_SLOTS)
+    {
+        uint32_t overwritten = end - cursor - RING_SLOTS;
+        if (overwritten > nb)
+            overwritten = nb;
+        memmove(out, out + overwritten, (nb - overwritten) * sizeof(*out));
+        nb -= overwritten;
+        lost += overwritten;
+    }
+
+    __atomic_store_n(&r->client->cursor, cursor + (uint32_t)copied, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&r->client->dropped, lost, __ATOMIC_RELAXED);
+    if (dropped)
+        *dropped += lost;
+    return nb;
+}
+
+#endif
@@ -0,0 +1,338 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adxl345.h"
+#include "adxl345_ring.h"
+
+/*
+ * Fan-out daemon: the only process opening /dev/adxl345-N. A reader thread
+ * drains the device in all axis mode and publishes the samples in a shared
+ * memory ring (see adxl345_ring.h), the main thread hands a read-only ring fd
+ * and a fresh client page to clients connecting on a UNIX socket and releases
+ * their slot when they leave. The client table doubles when it is full, so
+ * the number of clients is only limited by memory and open files.
+ */
+
+#define DEVICE_PATH "/dev/adxl345-0"
+#define SHM_NAME "/adxl345-0"
+#define BATCH 16 // samples per read, the driver returns at most its fifo size
+
+static struct adxl345_ring *ring;
+
+/* Daemon side view of the clients, protected by clients_lock */
+struct client
+{
+    int sock; // -1 if the slot is free
+    struct ring_client *page;
+    uint32_t lapped; // times the client was seen lapped in a row
+};
+
+static struct client *clients;
+static int nb_slots;
+static pthread_mutex_t clients_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *reader_thread(void *arg)
+{
+    int fd = *(int *)arg;
+    struct ring_sample batch[BATCH];
+    ssize_t bytes_read;
+    int i;
+
+    for (;;)
+    {
+        bytes_read = read(fd, batch, sizeof(batch));
+        if (bytes_read < 0)
+        {
+            printf("Error reading data\n");
+            exit(1);
+        }
+        ring_publish(ring, batch, bytes_read / sizeof(struct ring_sample));
+
+        pthread_mutex_lock(&clients_lock);
+        for (i = 0; i < nb_slots; i++)
+        {
+            struct client *c = &clients[i];
+            uint32_t lag;
+
+            if (c->sock < 0)
+                continue;
+            if (__atomic_load_n(&c->page->waiting, __ATOMIC_SEQ_CST))
+                ring_futex(&ring->head, FUTEX_WAKE, INT_MAX);
+
+            /* Report clients that fell more than a ring behind, once per lap */
+            lag = ring->head - __atomic_load_n(&c->page->cursor, __ATOMIC_ACQUIRE);
+            if (lag > RING_SLOTS * (c->lapped + 1))
+            {
+                c->lapped++;
+                printf("Client %d is lagging %u samples behind, dropping\n", i, lag);
+            }
+            else if (lag <= RING_SLOTS)
+            {
+                c->lapped = 0;
+            }
+        }
+        pthread_mutex_unlock(&clients_lock);
+    }
+    return NULL;
+}
+
+/* Creates an anonymous shared memory object, returns its fd */
+static int create_shm(const char *name, size_t size, int *ro_fd)
+{
+    int fd;
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0)
+    {
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+    if (fd < 0)
+        return -1;
+    /* A second, read-only, fd is the only way to hand out a mapping that
+       cannot be made writable */
+    if (ro_fd)
+        *ro_fd = shm_open(name, O_RDONLY, 0);
+    shm_unlink(name);
+    if (ftruncate(fd, size) < 0 || (ro_fd && *ro_fd < 0))
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Doubles the client table and the poll array (fds[0] is the listening
+   socket), new slots are free. Returns 0 on success */
+static int grow_clients(struct pollfd **fds)
+{
+    int size = nb_slots ? 2 * nb_slots : RING_INITIAL_CLIENTS;
+    struct pollfd *new_fds;
+    struct client *new_clients;
+    int i;
+
+    new_fds = realloc(*fds, (size + 1) * sizeof(struct pollfd));
+    if (!new_fds)
+        return -1;
+    *fds = new_fds;
+    for (i = nb_slots; i < size; i++)
+    {
+        new_fds[i + 1].fd = -1;
+        new_fds[i + 1].events = POLLIN;
+        new_fds[i + 1].revents = 0;
+    }
+
+    /* The reader thread walks the table, swap it under the lock */
+    pthread_mutex_lock(&clients_lock);
+    new_clients = realloc(clients, size * sizeof(struct client));
+    if (new_clients)
+    {
+        clients = new_clients;
+        for (i = nb_slots; i < size; i++)
+            clients[i].sock = -1;
+        nb_slots = size;
+    }
+    pthread_mutex_unlock(&clients_lock);
+    return new_clients ? 0 : -1;
+}
+
+static int send_ring(int sock, int ring_fd, int client_fd, int32_t slot)
+{
+    struct ring_attach_msg msg = {slot};
+    struct iovec iov = {&msg, sizeof(msg)};
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    int fds[2] = {ring_fd, client_fd};
+    struct msghdr hdr;
+    struct cmsghdr *cmsg;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memset(control, 0, sizeof(control));
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    if (slot >= 0)
+    {
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, 2 * sizeof(int));
+    }
+    return sendmsg(sock, &hdr, MSG_NOSIGNAL) == sizeof(msg) ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dev_path = argc > 1 ? argv[1] : DEVICE_PATH;
+    const char *sock_path = argc > 2 ? argv[2] : RING_SOCKET_PATH;
+    struct pollfd *fds = NULL;
+    struct sockaddr_un addr;
+    pthread_t thread;
+    int dev_fd, shm_fd, ring_ro_fd, listen_fd;
+    int i;
+
+    signal(SIGPIPE, SIG_IGN);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+
+    dev_fd = open(dev_path, O_RDWR);
+    if (dev_fd < 0)
+    {
+        printf("Error opening file\n");
+        return -1;
+    }
+    if (ioctl(dev_fd, ADXL345_SET_AXIS, ADXL345_AXIS_ALL) < 0)
+    {
+        printf("Error sending data\n");
+        return -1;
+    }
+
+    /* The name is unlinked right away, clients only get the ring through
+       the read-only fd passed on the socket */
+    shm_fd = create_shm(SHM_NAME, sizeof(struct adxl345_ring), &ring_ro_fd);
+    if (shm_fd < 0)
+    {
+        printf("Error creating shared memory\n");
+        return -1;
+    }
+    ring = mmap(NULL, sizeof(struct adxl345_ring), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (ring == MAP_FAILED)
+    {
+        printf("Error mapping shared memory\n");
+        return -1;
+    }
+    ring->magic = RING_MAGIC;
+    ring->slots = RING_SLOTS;
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+    {
+        printf("Error creating socket\n");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path) - 1);
+    unlink(sock_path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listen_fd, 8) < 0)
+    {
+        printf("Error binding socket %s\n", sock_path);
+        return -1;
+    }
+
+    if (grow_clients(&fds) < 0)
+    {
+        printf("Error allocating memory\n");
+        return -1;
+    }
+
+    if (pthread_create(&thread, NULL, reader_thread, &dev_fd))
+    {
+        printf("Error creating reader thread\n");
+        return -1;
+    }
+
+    /* fds[0] is the listening socket, fds[i + 1] the connection of slot i */
+    fds[0].fd = listen_fd;
+    fds[0].events = POLLIN;
+
+    printf("Serving %s on %s\n", dev_path, sock_path);
+    for (;;)
+    {
+        if (poll(fds, nb_slots + 1, -1) < 0)
+            continue;
+
+        for (i = 0; i < nb_slots; i++)
+        {
+            char c;
+            if (fds[i + 1].fd < 0 || !fds[i + 1].revents)
+                continue;
+            if (read(fds[i + 1].fd, &c, 1) > 0)
+                continue;
+            /* Client went away, release its slot and its page */
+            pthread_mutex_lock(&clients_lock);
+            clients[i].sock = -1;
+            munmap(clients[i].page, sizeof(struct ring_client));
+            pthread_mutex_unlock(&clients_lock);
+            close(fds[i + 1].fd);
+            fds[i + 1].fd = -1;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            int client = accept(listen_fd, NULL, NULL);
+            int32_t slot = -1;
+            int page_fd = -1;
+            struct ring_client *page = MAP_FAILED;
+            char name[32];
+
+            if (client < 0)
+                continue;
+            for (i = 0; i < nb_slots; i++)
+            {
+                if (fds[i + 1].fd < 0)
+                {
+                    slot = i;
+                    break;
+                }
+            }
+            if (slot < 0 && grow_clients(&fds) == 0)
+                slot = i;
+            if (slot >= 0)
+            {
+                /* A fresh page per client, so a previous client still holding
+                   the mapping of this slot cannot touch the new one */
+                snprintf(name, sizeof(name), "%s.%d", SHM_NAME, slot);
+                page_fd = create_shm(name, sizeof(struct ring_client), NULL);
+                if (page_fd >= 0)
+                    page = mmap(NULL, sizeof(struct ring_client), PROT_READ | PROT_WRITE,
+                                MAP_SHARED, page_fd, 0);
+                if (page == MAP_FAILED)
+                {
+                    printf("Error creating client page\n");
+                    slot = -1;
+                }
+                else
+                {
+                    /* New clients start at the live edge of the stream */
+                    page->cursor = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+                }
+            }
+            if (send_ring(client, ring_ro_fd, page_fd, slot) < 0 || slot < 0)
+            {
+                if (page != MAP_FAILED)
+                    munmap(page, sizeof(struct ring_client));
+                if (page_fd >= 0)
+                    close(page_fd);
+                close(client);
+                continue;
+            }
+            close(page_fd);
+
+            pthread_mutex_lock(&clients_lock);
+            clients[slot].page = page;
+            clients[slot].lapped = 0;
+            clients[slot].sock = client;
+            pthread_mutex_unlock(&clients_lock);
+            fds[slot + 1].fd = client;
+        }
+    }
+
+    return 0;
+}
+/*
+arm-linux-gnueabihf-gcc -Wall -O2 -static -pthread -o adxl345d adxl345d.c -lrt
+./adxl345d /dev/adxl345-0 /tmp/adxl345-0.sock &
+*/
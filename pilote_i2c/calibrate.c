@@ -0,0 +1,103 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adxl345.h"
+
+/*
+ * Offset calibration and self-test of the ADXL345, run with the sensor at
+ * rest, flat with Z up, and no other reader on the device.
+ * `set` restores offsets saved from a previous calibration, e.g. at boot.
+ */
+
+#define DEVICE_PATH "/dev/adxl345-0"
+#define NB_SAMPLES 100
+
+int main(int argc, char **argv)
+{
+    const char *cmd = argc > 1 ? argv[1] : "calibrate";
+    const char *path = DEVICE_PATH;
+    int ret = 0;
+    int fd;
+
+    if (!strcmp(cmd, "set") && argc > 5)
+        path = argv[5];
+    else if (strcmp(cmd, "set") && argc > 2)
+        path = argv[2];
+
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+    {
+        printf("Error opening file\n");
+        return -1;
+    }
+
+    if (!strcmp(cmd, "calibrate"))
+    {
+        struct adxl345_calibration calib = {.nb_samples = NB_SAMPLES};
+        if (ioctl(fd, ADXL345_CALIBRATE, &calib) < 0)
+        {
+            printf("Error calibrating\n");
+            ret = -1;
+        }
+        else
+        {
+            printf("Offsets: %d %d %d\n", calib.offset[0], calib.offset[1], calib.offset[2]);
+        }
+    }
+    else if (!strcmp(cmd, "selftest"))
+    {
+        struct adxl345_self_test test = {.nb_samples = NB_SAMPLES};
+        if (ioctl(fd, ADXL345_SELF_TEST, &test) < 0)
+        {
+            printf("Error running self-test\n");
+            ret = -1;
+        }
+        else
+        {
+            printf("Self-test %s: %d %d %d\n", test.passed ? "passed" : "failed",
+                   test.delta[0], test.delta[1], test.delta[2]);
+            ret = test.passed ? 0 : -1;
+        }
+    }
+    else if (!strcmp(cmd, "get"))
+    {
+        __s8 offset[3];
+        if (ioctl(fd, ADXL345_GET_OFFSETS, offset) < 0)
+        {
+            printf("Error reading offsets\n");
+            ret = -1;
+        }
+        else
+        {
+            printf("Offsets: %d %d %d\n", offset[0], offset[1], offset[2]);
+        }
+    }
+    else if (!strcmp(cmd, "set") && argc > 4)
+    {
+        __s8 offset[3] = {atoi(argv[2]), atoi(argv[3]), atoi(argv[4])};
+        if (ioctl(fd, ADXL345_SET_OFFSETS, offset) < 0)
+        {
+            printf("Error writing offsets\n");
+            ret = -1;
+        }
+    }
+    else
+    {
+        printf("Usage: %s calibrate|selftest|get [device]\n", argv[0]);
+        printf("       %s set <x> <y> <z> [device]\n", argv[0]);
+        ret = -1;
+    }
+
+    close(fd);
+    return ret;
+}
+/*
+arm-linux-gnueabihf-gcc -Wall -static -o calibrate calibrate.c
+./calibrate selftest && ./calibrate calibrate
+*/
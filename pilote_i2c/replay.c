@@ -0,0 +1,213 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "adxl345.h"
+
+/*
+ * Capture samples from a real device into a file, or play a capture back
+ * through /dev/adxl345-replay (module loaded with replay=1).
+ *
+ * Capture files are raw 6 byte samples (x y z, little-endian), the format
+ * read returns in all axis mode and the replay device accepts on write.
+ */
+
+#define DEVICE_PATH "/dev/adxl345-0"
+#define REPLAY_PATH "/dev/adxl345-replay"
+#define BATCH 64
+
+struct sample
+{
+    int16_t x;
+    int16_t y;
+    int16_t z;
+};
+
+static int capture(const char *dev_path, const char *file, unsigned long nb)
+{
+    struct sample batch[BATCH];
+    unsigned long done = 0;
+    FILE *out;
+    int fd;
+
+    fd = open(dev_path, O_RDWR);
+    if (fd < 0)
+    {
+        printf("Error opening file\n");
+        return -1;
+    }
+    if (ioctl(fd, ADXL345_SET_AXIS, ADXL345_AXIS_ALL) < 0)
+    {
+        printf("Error sending data\n");
+        close(fd);
+        return -1;
+    }
+    out = fopen(file, "wb");
+    if (!out)
+    {
+        printf("Error opening %s\n", file);
+        close(fd);
+        return -1;
+    }
+
+    while (done < nb)
+    {
+        ssize_t bytes_read = read(fd, batch, sizeof(batch));
+        size_t count;
+
+        if (bytes_read < 0)
+        {
+            printf("Error reading data\n");
+            break;
+        }
+        count = bytes_read / sizeof(struct sample);
+        if (count > nb - done)
+            count = nb - done;
+        fwrite(batch, sizeof(struct sample), count, out);
+        done += count;
+    }
+
+    printf("Captured %lu samples\n", done);
+    fclose(out);
+    close(fd);
+    return done == nb ? 0 : -1;
+}
+
+/* Every `every` samples written, inject one burst, gap and overrun of the
+   requested sizes (0 disables an injection) */
+static int play(const char *file, unsigned long scale, unsigned long every,
+                unsigned long burst, unsigned long gap, unsigned long overrun, int loops)
+{
+    struct sample batch[BATCH];
+    unsigned long written = 0, next_inject = every;
+    FILE *in;
+    int fd, loop;
+
+    fd = open(REPLAY_PATH, O_RDWR);
+    if (fd < 0)
+    {
+        printf("Error opening file\n");
+        return -1;
+    }
+    if (ioctl(fd, ADXL345_REPLAY_SCALE, scale) < 0)
+    {
+        printf("Error sending data\n");
+        close(fd);
+        return -1;
+    }
+    in = fopen(file, "rb");
+    if (!in)
+    {
+        printf("Error opening %s\n", file);
+        close(fd);
+        return -1;
+    }
+
+    for (loop = 0; loops == 0 || loop < loops; loop++)
+    {
+        size_t count;
+
+        rewind(in);
+        while ((count = fread(batch, sizeof(struct sample), BATCH, in)) > 0)
+        {
+            const char *p = (const char *)batch;
+            size_t left = count * sizeof(struct sample);
+
+            while (left > 0)
+            {
+                ssize_t ret = write(fd, p, left);
+                if (ret < 0)
+                {
+                    printf("Error writing data\n");
+                    fclose(in);
+                    close(fd);
+                    return -1;
+                }
+                p += ret;
+                left -= ret;
+            }
+            written += count;
+
+            if (every && written >= next_inject)
+            {
+                next_inject += every;
+                if ((burst && ioctl(fd, ADXL345_REPLAY_BURST, burst) < 0) ||
+                    (gap && ioctl(fd, ADXL345_REPLAY_GAP, gap) < 0) ||
+                    (overrun && ioctl(fd, ADXL345_REPLAY_OVERRUN, overrun) < 0))
+                {
+                    printf("Error sending data\n");
+                }
+            }
+        }
+    }
+
+    printf("Replayed %lu samples\n", written);
+    fclose(in);
+    close(fd);
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s capture <file> <nb samples> [device]\n", name);
+    printf("       %s play <file> [-s scale] [-l loops] [-e every] [-b burst] [-g gap] [-o overrun]\n", name);
+    printf("       scale 0 replays as fast as readers drain, loops 0 repeats forever\n");
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long scale = 1, every = 0, burst = 0, gap = 0, overrun = 0;
+    int loops = 1;
+    int opt;
+
+    if (argc >= 4 && !strcmp(argv[1], "capture"))
+        return capture(argc > 4 ? argv[4] : DEVICE_PATH, argv[2], strtoul(argv[3], NULL, 0));
+
+    if (argc < 3 || strcmp(argv[1], "play"))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+    optind = 3;
+    while ((opt = getopt(argc, argv, "s:l:e:b:g:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            scale = strtoul(optarg, NULL, 0);
+            break;
+        case 'l':
+            loops = atoi(optarg);
+            break;
+        case 'e':
+            every = strtoul(optarg, NULL, 0);
+            break;
+        case 'b':
+            burst = strtoul(optarg, NULL, 0);
+            break;
+        case 'g':
+            gap = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            overrun = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
+        }
+    }
+    return play(argv[2], scale, every, burst, gap, overrun, loops);
+}
+/*
+arm-linux-gnueabihf-gcc -Wall -static -o replay replay.c
+insmod adxl345.ko replay=1
+./replay capture capture.bin 6000
+./replay play capture.bin -s 10 -l 0 -e 1000 -b 16 -g 50 &
+./vibration -d /dev/adxl345-replay
+*/
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdint.h>
+
+#include "adxl345_ring.h"
+
+/* Example client of adxl345d: prints every sample and reports drops */
+
+#define BATCH 64
+
+int main(int argc, char **argv)
+{
+    const char *sock_path = argc > 1 ? argv[1] : RING_SOCKET_PATH;
+    struct ring_reader reader;
+    struct ring_sample samples[BATCH];
+    uint32_t dropped = 0;
+
+    if (ring_attach(sock_path, &reader) < 0)
+    {
+        printf("Error attaching to %s\n", sock_path);
+        return -1;
+    }
+
+    for (;;)
+    {
+        uint32_t lost = 0;
+        size_t nb = ring_read(&reader, samples, BATCH, &lost);
+        size_t i;
+
+        if (lost)
+        {
+            dropped += lost;
+            printf("Dropped %u samples (%u total)\n", lost, dropped);
+        }
+        for (i = 0; i < nb; i++)
+            printf("Read:%d %d %d\n", samples[i].x, samples[i].y, samples[i].z);
+    }
+
+    ring_detach(&reader);
+    return 0;
+}
+/*
+arm-linux-gnueabihf-gcc -Wall -static -o ring_client ring_client.c
+*/
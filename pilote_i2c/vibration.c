@@ -0,0 +1,419 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "adxl345.h"
+
+/*
+ * Streaming vibration analysis on top of /dev/adxl345-N.
+ *
+ * Samples are read in batches (all axis mode), pushed into a per-axis ring
+ * of the last N samples, and every `hop` samples (hop <= N, so windows
+ * overlap and every sample is analysed) a feature record is emitted for the
+ * current window: RMS, peak, crest factor and the RMS of NB_BANDS
+ * equal-width bands of the Hann-windowed spectrum. The window mean (gravity
+ * and sensor bias) is removed first, so the features only describe the
+ * vibration. All buffers are allocated once at startup.
+ *
+ * Records are written to stdout as fixed-size binary struct feature_record
+ * (little-endian), or as one text line each with -t. Diagnostics go to
+ * stderr so they never mix with the record stream.
+ */
+
+#define DEVICE_PATH "/dev/adxl345-0"
+#define SAMPLE_RATE 100 // Hz, matches the BW_RATE value set by the driver
+#define NB_AXIS 3
+#define NB_BANDS 4
+#define BATCH 16 // samples per read, the driver returns at most its fifo size
+#define DEFAULT_WINDOW 256 // 2.56 s, the default hop is half of it: 46 B instead of 768 B of samples
+
+struct sample
+{
+    int16_t x;
+    int16_t y;
+    int16_t z;
+};
+
+struct analyzer
+{
+    size_t n;    // window length, power of two
+    size_t hop;  // samples between two records
+    size_t head; // next write position in the rings
+    size_t fill; // valid samples in the rings (saturates at n)
+    size_t since_record;
+
+    int16_t *ring[NB_AXIS];
+    int64_t sum[NB_AXIS];    // running sum over the ring
+    int64_t sum_sq[NB_AXIS]; // running sum of squares over the ring
+
+    /* Precomputed tables, sized for a real FFT of n points done as a complex
+       FFT of n/2 points followed by a split step */
+    float *hann;
+    float band_scale; // 2 / (n * sum of hann^2), turns |X|^2 into mean square
+    float *cos_half;  // twiddles of the n/2 point FFT
+    float *sin_half;
+    float *cos_full;  // twiddles of the split step
+    float *sin_full;
+    size_t *bitrev;
+    float *re;
+    float *im;
+};
+
+struct features
+{
+    float rms;
+    float peak;
+    float crest;
+    float band[NB_BANDS]; // mean square of each band, they add up to rms^2
+};
+
+/* Output record, 46 bytes, amplitudes in LSB (3.9 mg) */
+struct feature_record
+{
+    uint32_t index;
+    struct
+    {
+        uint16_t rms;
+        uint16_t peak;
+        uint16_t crest; // x100
+        uint16_t band[NB_BANDS]; // RMS of each band
+    } axis[NB_AXIS];
+} __attribute__((packed));
+
+static int is_power_of_two(size_t v)
+{
+    return v && !(v & (v - 1));
+}
+
+static void *xcalloc(size_t nmemb, size_t size)
+{
+    void *p = calloc(nmemb, size);
+    if (!p)
+    {
+        fprintf(stderr, "Error allocating memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void analyzer_init(struct analyzer *a, size_t n, size_t hop)
+{
+    size_t m = n / 2;
+    size_t bits = 0;
+    size_t i, j;
+
+    memset(a, 0, sizeof(*a));
+    a->n = n;
+    a->hop = hop;
+
+    for (i = 0; i < NB_AXIS; i++)
+        a->ring[i] = xcalloc(n, sizeof(int16_t));
+
+    a->hann = xcalloc(n, sizeof(float));
+    for (i = 0; i < n; i++)
+    {
+        a->hann[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / n);
+        a->band_scale += a->hann[i] * a->hann[i];
+    }
+    a->band_scale = 2.0f / (n * a->band_scale);
+
+    a->cos_half = xcalloc(m / 2 + 1, sizeof(float));
+    a->sin_half = xcalloc(m / 2 + 1, sizeof(float));
+    for (i = 0; i <= m / 2; i++)
+    {
+        a->cos_half[i] = cosf(2.0f * (float)M_PI * i / m);
+        a->sin_half[i] = -sinf(2.0f * (float)M_PI * i / m);
+    }
+
+    a->cos_full = xcalloc(m + 1, sizeof(float));
+    a->sin_full = xcalloc(m + 1, sizeof(float));
+    for (i = 0; i <= m; i++)
+    {
+        a->cos_full[i] = cosf(2.0f * (float)M_PI * i / n);
+        a->sin_full[i] = -sinf(2.0f * (float)M_PI * i / n);
+    }
+
+    while (((size_t)1 << bits) < m)
+        bits++;
+    a->bitrev = xcalloc(m, sizeof(size_t));
+    for (i = 0; i < m; i++)
+    {
+        size_t r = 0;
+        for (j = 0; j < bits; j++)
+            r |= ((i >> j) & 1) << (bits - 1 - j);
+        a->bitrev[i] = r;
+    }
+
+    a->re = xcalloc(m, sizeof(float));
+    a->im = xcalloc(m, sizeof(float));
+}
+
+static void analyzer_free(struct analyzer *a)
+{
+    size_t i;
+
+    for (i = 0; i < NB_AXIS; i++)
+        free(a->ring[i]);
+    free(a->hann);
+    free(a->cos_half);
+    free(a->sin_half);
+    free(a->cos_full);
+    free(a->sin_full);
+    free(a->bitrev);
+    free(a->re);
+    free(a->im);
+}
+
+/* In place radix-2 FFT of a->re/a->im (n/2 points, input already in
+   bit-reversed order) */
+static void fft_half(struct analyzer *a)
+{
+    size_t m = a->n / 2;
+    size_t len, i, k;
+
+    for (len = 2; len <= m; len <<= 1)
+    {
+        size_t step = m / len;
+        for (i = 0; i < m; i += len)
+        {
+            for (k = 0; k < len / 2; k++)
+            {
+                float wr = a->cos_half[k * step];
+                float wi = a->sin_half[k * step];
+                size_t p = i + k;
+                size_t q = p + len / 2;
+                float tr = a->re[q] * wr - a->im[q] * wi;
+                float ti = a->re[q] * wi + a->im[q] * wr;
+                a->re[q] = a->re[p] - tr;
+                a->im[q] = a->im[p] - ti;
+                a->re[p] += tr;
+                a->im[p] += ti;
+            }
+        }
+    }
+}
+
+/* Windows the last n samples of one axis, transforms them and fills the
+   time and frequency domain features */
+static void analyze_axis(struct analyzer *a, int axis, struct features *f)
+{
+    size_t n = a->n;
+    size_t m = n / 2;
+    size_t start = a->head; // oldest sample of the window
+    const int16_t *ring = a->ring[axis];
+    size_t band_width = (m + NB_BANDS - 1) / NB_BANDS;
+    float mean = (float)a->sum[axis] / n;
+    float var = (float)a->sum_sq[axis] / n - mean * mean;
+    float peak = 0.0f;
+    size_t i, k;
+
+    /* Pack even samples in the real part and odd samples in the imaginary
+       part of an n/2 point complex sequence, in bit-reversed order */
+    for (i = 0; i < m; i++)
+    {
+        float s0 = ring[(start + 2 * i) % n] - mean;
+        float s1 = ring[(start + 2 * i + 1) % n] - mean;
+
+        if (fabsf(s0) > peak)
+            peak = fabsf(s0);
+        if (fabsf(s1) > peak)
+            peak = fabsf(s1);
+
+        a->re[a->bitrev[i]] = s0 * a->hann[2 * i];
+        a->im[a->bitrev[i]] = s1 * a->hann[2 * i + 1];
+    }
+
+    fft_half(a);
+
+    memset(f->band, 0, sizeof(f->band));
+    /* Split step: recover bins 0..n/2 of the real FFT from the n/2 point
+       complex FFT; the DC bin is left out of the bands */
+    for (k = 1; k <= m; k++)
+    {
+        size_t kk = (k == m) ? 0 : k;
+        size_t mk = (m - k) % m;
+        float zr = a->re[kk], zi = a->im[kk];
+        float cr = a->re[mk], ci = -a->im[mk];      // conj(Z[m-k])
+        float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+        float odr = 0.5f * (zi - ci), odi = -0.5f * (zr - cr); // (Z - conj) / 2i
+        float wr = a->cos_full[k], wi = a->sin_full[k];
+        float xr = er + odr * wr - odi * wi;
+        float xi = ei + odr * wi + odi * wr;
+        size_t band = (k - 1) / band_width;
+
+        if (band >= NB_BANDS)
+            band = NB_BANDS - 1;
+        // The Nyquist bin has no mirror image, it only counts once
+        f->band[band] += (xr * xr + xi * xi) * a->band_scale * (k == m ? 0.5f : 1.0f);
+    }
+
+    f->rms = var > 0.0f ? sqrtf(var) : 0.0f;
+    f->peak = peak;
+    f->crest = f->rms > 0.0f ? peak / f->rms : 0.0f;
+}
+
+/* Pushes one sample, returns 1 when a record is due */
+static int analyzer_push(struct analyzer *a, const struct sample *s)
+{
+    int16_t v[NB_AXIS] = {s->x, s->y, s->z};
+    int i;
+
+    for (i = 0; i < NB_AXIS; i++)
+    {
+        int16_t old = a->ring[i][a->head];
+        a->sum[i] += v[i] - old;
+        a->sum_sq[i] += (int64_t)v[i] * v[i] - (int64_t)old * old;
+        a->ring[i][a->head] = v[i];
+    }
+    a->head = (a->head + 1) % a->n;
+
+    /* First record as soon as the window is full, then one every hop */
+    if (a->fill < a->n)
+    {
+        a->fill++;
+        return a->fill == a->n;
+    }
+    if (++a->since_record < a->hop)
+        return 0;
+    a->since_record = 0;
+    return 1;
+}
+
+static uint16_t to_u16(float v)
+{
+    if (v <= 0.0f)
+        return 0;
+    return v >= 65535.0f ? 65535 : (uint16_t)(v + 0.5f);
+}
+
+static void write_record(unsigned long index, const struct features f[NB_AXIS], int text)
+{
+    struct feature_record r;
+    int i, b;
+
+    r.index = index;
+    for (i = 0; i < NB_AXIS; i++)
+    {
+        r.axis[i].rms = to_u16(f[i].rms);
+        r.axis[i].peak = to_u16(f[i].peak);
+        r.axis[i].crest = to_u16(f[i].crest * 100.0f);
+        for (b = 0; b < NB_BANDS; b++)
+            r.axis[i].band[b] = to_u16(sqrtf(f[i].band[b]));
+    }
+
+    if (!text)
+    {
+        fwrite(&r, sizeof(r), 1, stdout);
+        fflush(stdout);
+        return;
+    }
+
+    /* index, then for x y z: rms peak crest band0..band3 */
+    printf("%u", r.index);
+    for (i = 0; i < NB_AXIS; i++)
+    {
+        printf(" %u %u %u.%02u", r.axis[i].rms, r.axis[i].peak, r.axis[i].crest / 100,
+               r.axis[i].crest % 100);
+        for (b = 0; b < NB_BANDS; b++)
+            printf(" %u", r.axis[i].band[b]);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = DEVICE_PATH;
+    size_t n = DEFAULT_WINDOW;
+    size_t hop = 0; // n / 2 unless given
+    struct analyzer a;
+    struct sample batch[BATCH];
+    struct features f[NB_AXIS];
+    unsigned long records = 0;
+    int text = 0;
+    int fd, opt;
+
+    while ((opt = getopt(argc, argv, "d:n:s:t")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            path = optarg;
+            break;
+        case 'n':
+            n = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            hop = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            text = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-d device] [-n window] [-s hop] [-t]\n", argv[0]);
+            return -1;
+        }
+    }
+    if (hop == 0)
+        hop = n / 2;
+    if (n < 4 || !is_power_of_two(n) || hop > n)
+    {
+        fprintf(stderr, "Window must be a power of two >= 4 and hop <= window\n");
+        return -1;
+    }
+
+    fd = open(path, O_RDWR);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Error opening file\n");
+        return -1;
+    }
+    if (ioctl(fd, ADXL345_SET_AXIS, ADXL345_AXIS_ALL) < 0)
+    {
+        fprintf(stderr, "Error sending data\n");
+        close(fd);
+        return -1;
+    }
+
+    analyzer_init(&a, n, hop);
+    fprintf(stderr, "window=%zu samples (%.2f s), one %zu byte record every %zu samples (%.2f s)\n",
+            n, (float)n / SAMPLE_RATE, sizeof(struct feature_record), hop, (float)hop / SAMPLE_RATE);
+
+    for (;;)
+    {
+        ssize_t bytes_read = read(fd, batch, sizeof(batch));
+        size_t i, nb;
+
+        if (bytes_read < 0)
+        {
+            fprintf(stderr, "Error reading data\n");
+            break;
+        }
+        nb = bytes_read / sizeof(struct sample);
+        for (i = 0; i < nb; i++)
+        {
+            if (!analyzer_push(&a, &batch[i]))
+                continue;
+            analyze_axis(&a, 0, &f[0]);
+            analyze_axis(&a, 1, &f[1]);
+            analyze_axis(&a, 2, &f[2]);
+            write_record(records++, f, text);
+        }
+    }
+
+    analyzer_free(&a);
+    close(fd);
+    return 0;
+}
+/*
+arm-linux-gnueabihf-gcc -Wall -O2 -static -o vibration vibration.c -lm
+./vibration -d /dev/adxl345-0 -n 256 -s 128 > features.bin
+./vibration -d /dev/adxl345-0 -t
+*/